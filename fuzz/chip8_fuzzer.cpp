@@ -0,0 +1,36 @@
+#include <cstddef>
+#include <cstdint>
+
+#include "../src/chip8.h"
+
+// upper bound per input, so looping ROMs still finish: frames of cyclesPerFrame
+// instructions, with the timers ticked in between as the host does
+const int maxFrames = 4;
+const int cyclesPerFrame = 32;
+
+chip8 fuzzChip8;
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    fuzzChip8.verbose = false;
+    fuzzChip8.checked = true;
+    fuzzChip8.initialise();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // only undo what the previous input touched
+    fuzzChip8.reset();
+
+    if (!fuzzChip8.loadProgram(data, size)) { return -1; }  // too big, don't add to corpus
+
+    // no keys are ever pressed, so once idle nothing but the timers would change
+    for (int frame = 0; frame < maxFrames && fuzzChip8.getFault() == chip8Fault::none && !fuzzChip8.idle(); ++frame)
+    {
+        fuzzChip8.emulateCycles(cyclesPerFrame);
+        fuzzChip8.tickTimers();
+    }
+
+    return 0;
+}
@@ -0,0 +1,468 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "analyser.h"
+
+const int romStartAddress = 0x200;
+
+// I as tracked through the program: a known address, or one of these
+const int unvisited = -2;
+const int unknownI = -1;
+
+struct romWrite {
+    int writer;
+    int startByte;
+    int stopByte;
+};
+
+bool romMetadata::pureCode()
+{
+    return selfModifyingWrites.empty() && unknownWrites.empty() && indirectJumps.empty();
+}
+
+std::uint32_t hashProgram(const unsigned char* program, std::size_t size)
+{
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= program[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// instructions allowed in the body of a polling loop, ones that only read
+static bool onlyReads(unsigned short opcode)
+{
+    switch (opcode & 0xF000)
+    {
+        case 0x3000:
+        case 0x4000:
+            return true;
+        case 0x5000:
+        case 0x9000:
+            return (opcode & 0x000F) == 0;
+        case 0xE000:
+            return (opcode & 0x00FF) == 0x009E || (opcode & 0x00FF) == 0x00A1;
+        case 0xF000:
+            return (opcode & 0x00FF) == 0x0007;
+        default:
+            return false;
+    }
+}
+
+romMetadata analyseProgram(const unsigned char* program, std::size_t size)
+{
+    romMetadata metadata;
+    metadata.hash = hashProgram(program, size);
+    metadata.programSize = size;
+    metadata.flags.assign(size, 0);
+
+    // I on entry to each instruction, merged to unknownI where paths disagree
+    std::vector<int> entryI(size, unvisited);
+    std::vector<int> worklist;
+    std::vector<romWrite> writes;
+
+    auto visit = [&](int address, int i)
+    {
+        int offset = address - romStartAddress;
+        if (offset < 0 || offset + 1 >= (int) size) { return; }
+
+        if (entryI[offset] == unvisited) { entryI[offset] = i; }
+        else if (entryI[offset] == i || entryI[offset] == unknownI) { return; }
+        else { entryI[offset] = unknownI; }
+
+        worklist.push_back(address);
+    };
+
+    // reset() leaves I at 0
+    visit(romStartAddress, 0);
+
+    while (!worklist.empty())
+    {
+        int address = worklist.back();
+        worklist.pop_back();
+
+        int offset = address - romStartAddress;
+        unsigned short opcode = program[offset] << 8 | program[offset + 1];
+        int i = entryI[offset];
+        int x = (opcode & 0x0F00) >> 8;
+        int next = address + 2;
+
+        metadata.flags[offset] |= romCode;
+        metadata.flags[offset + 1] |= romOperand;
+
+        switch (opcode & 0xF000)
+        {
+            case 0x0000:
+            {
+                if (opcode == 0x00E0) { visit(next, i); }
+                // 00EE returns to the instruction after its 2NNN, anything else is SYS / unknown
+                break;
+            }
+            case 0x1000:
+            {
+                if ((opcode & 0x0FFF) == address) { metadata.idleLoops.push_back(address); }
+                else { visit(opcode & 0x0FFF, i); }
+                break;
+            }
+            case 0x2000:
+            {
+                visit(opcode & 0x0FFF, i);
+                // I after the call isn't known without following the subroutine through
+                visit(next, unknownI);
+                break;
+            }
+            case 0x3000:
+            case 0x4000:
+            case 0x5000:
+            case 0x9000:
+            {
+                visit(next, i);
+                visit(next + 2, i);
+                break;
+            }
+            case 0xA000:
+            {
+                visit(next, opcode & 0x0FFF);
+                break;
+            }
+            case 0xB000:
+            {
+                metadata.indirectJumps.push_back(address);
+                break;
+            }
+            case 0xD000:
+            {
+                if (i >= 0)
+                {
+                    for (int line = 0; line < (opcode & 0x000F); ++line)
+                    {
+                        int sprite = i + line - romStartAddress;
+                        if (sprite >= 0 && sprite < (int) size) { metadata.flags[sprite] |= romSprite; }
+                    }
+                }
+                visit(next, i);
+                break;
+            }
+            case 0xE000:
+            {
+                visit(next, i);
+                visit(next + 2, i);
+                break;
+            }
+            case 0xF000:
+            {
+                switch (opcode & 0x00FF)
+                {
+                    case 0x001E:
+                    case 0x0029:
+                        visit(next, unknownI);
+                        break;
+                    case 0x0033:
+                    case 0x0055:
+                    {
+                        int length = (opcode & 0x00FF) == 0x0033 ? 3 : x + 1;
+                        if (i >= 0) { writes.push_back({ address, i, i + length }); }
+                        else { metadata.unknownWrites.push_back(address); }
+                        visit(next, i);
+                        break;
+                    }
+                    default:
+                        visit(next, i);
+                        break;
+                }
+                break;
+            }
+            default:
+                visit(next, i);
+                break;
+        }
+    }
+
+    for (romWrite& write : writes)
+    {
+        bool overCode = false;
+        for (int byte = write.startByte; byte < write.stopByte; ++byte)
+        {
+            int offset = byte - romStartAddress;
+            if (offset < 0 || offset >= (int) size) { continue; }
+
+            metadata.flags[offset] |= romWritten;
+            if (metadata.flags[offset] & (romCode | romOperand)) { overCode = true; }
+        }
+        if (overCode) { metadata.selfModifyingWrites.push_back(write.writer); }
+    }
+
+    // backward jumps over at most 4 instructions that only read
+    for (int offset = 0; offset + 1 < (int) size; ++offset)
+    {
+        if (!(metadata.flags[offset] & romCode)) { continue; }
+
+        unsigned short opcode = program[offset] << 8 | program[offset + 1];
+        int address = offset + romStartAddress;
+        int target = opcode & 0x0FFF;
+        if ((opcode & 0xF000) != 0x1000 || target >= address || address - target > 8) { continue; }
+
+        bool polling = target >= romStartAddress;
+        for (int body = target; polling && body < address; body += 2)
+        {
+            int bodyOffset = body - romStartAddress;
+            polling = (metadata.flags[bodyOffset] & romCode) &&
+                      onlyReads(program[bodyOffset] << 8 | program[bodyOffset + 1]);
+        }
+        if (polling) { metadata.pollingLoops.push_back(address); }
+    }
+
+    std::sort(metadata.idleLoops.begin(), metadata.idleLoops.end());
+    std::sort(metadata.selfModifyingWrites.begin(), metadata.selfModifyingWrites.end());
+    std::sort(metadata.indirectJumps.begin(), metadata.indirectJumps.end());
+    std::sort(metadata.unknownWrites.begin(), metadata.unknownWrites.end());
+
+    return metadata;
+}
+
+std::string disassemble(unsigned short opcode)
+{
+    char text[32];
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int n = opcode & 0x000F;
+    int nn = opcode & 0x00FF;
+    int nnn = opcode & 0x0FFF;
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (opcode == 0x00E0) { return "CLS"; }
+            if (opcode == 0x00EE) { return "RET"; }
+            std::snprintf(text, sizeof(text), "SYS 0x%03X", nnn);
+            break;
+        case 0x1000: std::snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+        case 0x2000: std::snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+        case 0x3000: std::snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+        case 0x4000: std::snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+        case 0x5000:
+            if (n != 0) { return "???"; }
+            std::snprintf(text, sizeof(text), "SE V%X, V%X", x, y);
+            break;
+        case 0x6000: std::snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+        case 0x7000: std::snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+        case 0x8000:
+        {
+            const char* names[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                                      nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr };
+            if (!names[n]) { return "???"; }
+            std::snprintf(text, sizeof(text), "%s V%X, V%X", names[n], x, y);
+            break;
+        }
+        case 0x9000:
+            if (n != 0) { return "???"; }
+            std::snprintf(text, sizeof(text), "SNE V%X, V%X", x, y);
+            break;
+        case 0xA000: std::snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+        case 0xB000: std::snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn); break;
+        case 0xC000: std::snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+        case 0xD000: std::snprintf(text, sizeof(text), "DRW V%X, V%X, %d", x, y, n); break;
+        case 0xE000:
+            if (nn == 0x9E) { std::snprintf(text, sizeof(text), "SKP V%X", x); }
+            else if (nn == 0xA1) { std::snprintf(text, sizeof(text), "SKNP V%X", x); }
+            else { return "???"; }
+            break;
+        case 0xF000:
+            switch (nn)
+            {
+                case 0x07: std::snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+                case 0x0A: std::snprintf(text, sizeof(text), "LD V%X, K", x); break;
+                case 0x15: std::snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+                case 0x18: std::snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+                case 0x1E: std::snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+                case 0x29: std::snprintf(text, sizeof(text), "LD F, V%X", x); break;
+                case 0x33: std::snprintf(text, sizeof(text), "LD B, V%X", x); break;
+                case 0x55: std::snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+                case 0x65: std::snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+                default: return "???";
+            }
+            break;
+    }
+    return text;
+}
+
+static bool contains(std::vector<int>& addresses, int address)
+{
+    return std::find(addresses.begin(), addresses.end(), address) != addresses.end();
+}
+
+void printDisassembly(const unsigned char* program, std::size_t size, romMetadata& metadata)
+{
+    int offset = 0;
+    while (offset < (int) size)
+    {
+        int address = offset + romStartAddress;
+        unsigned char flags = metadata.flags[offset];
+
+        if ((flags & romCode) && offset + 1 < (int) size)
+        {
+            unsigned short opcode = program[offset] << 8 | program[offset + 1];
+            printf("0x%.3X : %.4X  %-16s", address, opcode, disassemble(opcode).c_str());
+
+            if (contains(metadata.idleLoops, address)) { printf(" ; idle loop"); }
+            if (contains(metadata.pollingLoops, address)) { printf(" ; polling loop"); }
+            if (contains(metadata.selfModifyingWrites, address)) { printf(" ; writes over code"); }
+            if (contains(metadata.unknownWrites, address)) { printf(" ; writes through unknown I"); }
+            if (contains(metadata.indirectJumps, address)) { printf(" ; indirect jump"); }
+            if (flags & romSprite) { printf(" ; read as sprite"); }
+            if (flags & romWritten) { printf(" ; self-modified"); }
+
+            // a jump into the middle of this instruction starts another one at the next byte,
+            // step by one so it gets its own line
+            bool overlapsNext = metadata.flags[offset + 1] & romCode;
+            bool overlapsPrevious = offset > 0 && (metadata.flags[offset - 1] & romCode);
+            if (overlapsPrevious || overlapsNext) { printf(" ; overlapping instruction"); }
+            printf("\n");
+            offset += overlapsNext ? 1 : 2;
+            continue;
+        }
+
+        printf("0x%.3X : %.2X    db 0x%.2X          ", address, program[offset], program[offset]);
+        if (flags & romSprite)
+        {
+            // sprite row as pixels
+            printf(" ; sprite ");
+            for (int bit = 7; bit >= 0; --bit) { printf("%c", (program[offset] >> bit) & 1 ? '#' : '.'); }
+        }
+        if (flags & romWritten) { printf(" ; written"); }
+        printf("\n");
+        ++offset;
+    }
+}
+
+std::filesystem::path metadataPath(std::filesystem::path pathName)
+{
+    pathName += ".meta";
+    return pathName;
+}
+
+static void writeAddresses(std::ofstream& file, const char* name, std::vector<int>& addresses)
+{
+    file << name;
+    for (int address : addresses) { file << " " << address; }
+    file << "\n";
+}
+
+bool saveMetadata(std::filesystem::path pathName, romMetadata& metadata)
+{
+    std::ofstream file(pathName);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // flags fit in one hex digit per byte
+    const char* digits = "0123456789ABCDEF";
+    std::string flags;
+    for (unsigned char flag : metadata.flags) { flags += digits[flag & 0x0F]; }
+
+    file << "chip8-metadata 1\n";
+    file << "hash " << metadata.hash << "\n";
+    file << "size " << metadata.programSize << "\n";
+    file << "flags " << flags << "\n";
+    writeAddresses(file, "idle", metadata.idleLoops);
+    writeAddresses(file, "polling", metadata.pollingLoops);
+    writeAddresses(file, "selfmodifying", metadata.selfModifyingWrites);
+    writeAddresses(file, "indirect", metadata.indirectJumps);
+    writeAddresses(file, "unknownwrites", metadata.unknownWrites);
+
+    return file.good();
+}
+
+// every listed address must be an instruction, both bytes inside the program
+static bool validAddresses(std::vector<int>& addresses, std::vector<unsigned char>& flags)
+{
+    for (int address : addresses)
+    {
+        int offset = address - romStartAddress;
+        if (offset < 0 || offset + 1 >= (int) flags.size() || !(flags[offset] & romCode)) { return false; }
+    }
+    return true;
+}
+
+bool loadMetadata(std::filesystem::path pathName, const unsigned char* program, std::size_t size,
+                  romMetadata& metadata)
+{
+    std::ifstream file(pathName);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    romMetadata loaded;
+    std::string line;
+    std::string name;
+    int version = 0;
+    if (!std::getline(file, line) || std::sscanf(line.c_str(), "chip8-metadata %d", &version) != 1 || version != 1)
+    {
+        return false;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        fields >> name;
+
+        if (name == "hash")
+        {
+            if (!(fields >> loaded.hash)) { return false; }
+        }
+        else if (name == "size")
+        {
+            if (!(fields >> loaded.programSize)) { return false; }
+        }
+        else if (name == "flags")
+        {
+            std::string flags;
+            fields >> flags;
+            for (char digit : flags)
+            {
+                if (digit >= '0' && digit <= '9') { loaded.flags.push_back(digit - '0'); }
+                else if (digit >= 'A' && digit <= 'F') { loaded.flags.push_back(digit - 'A' + 10); }
+                else { return false; }
+            }
+        }
+        else
+        {
+            std::vector<int>* addresses = nullptr;
+            if (name == "idle") { addresses = &loaded.idleLoops; }
+            else if (name == "polling") { addresses = &loaded.pollingLoops; }
+            else if (name == "selfmodifying") { addresses = &loaded.selfModifyingWrites; }
+            else if (name == "indirect") { addresses = &loaded.indirectJumps; }
+            else if (name == "unknownwrites") { addresses = &loaded.unknownWrites; }
+            else { continue; }
+
+            int address;
+            while (fields >> address) { addresses->push_back(address); }
+            if (!fields.eof()) { return false; }
+        }
+    }
+
+    // stale: the rom has changed since the metadata was written
+    if (loaded.programSize != (int) size || loaded.flags.size() != size ||
+        loaded.hash != hashProgram(program, size))
+    {
+        return false;
+    }
+
+    // anything the analysis couldn't have written is treated as stale too
+    if (size > 0 && (loaded.flags[size - 1] & romCode)) { return false; }
+    if (!validAddresses(loaded.idleLoops, loaded.flags) || !validAddresses(loaded.pollingLoops, loaded.flags) ||
+        !validAddresses(loaded.selfModifyingWrites, loaded.flags) ||
+        !validAddresses(loaded.indirectJumps, loaded.flags) || !validAddresses(loaded.unknownWrites, loaded.flags))
+    {
+        return false;
+    }
+
+    metadata = loaded;
+    return true;
+}
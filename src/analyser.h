@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// per byte flags, a byte with none of code / operand set is data
+enum romByteFlags : unsigned char {
+    romCode = 0x01,  // first byte of a reachable instruction
+    romOperand = 0x02,  // second byte of a reachable instruction
+    romSprite = 0x04,  // read by DXYN through an I set by ANNN
+    romWritten = 0x08  // written by FX33 / FX55 through an I set by ANNN
+};
+
+// results of following control flow from 0x200 through a program
+struct romMetadata {
+    std::uint32_t hash = 0;  // FNV-1a of the program, to spot stale metadata
+    int programSize = 0;
+
+    // one entry per program byte, starting at 0x200
+    std::vector<unsigned char> flags;
+
+    // 1NNN jumping to itself, nothing changes until the next frame
+    std::vector<int> idleLoops;
+    // short backward loops that only read timers, keys or registers
+    std::vector<int> pollingLoops;
+    // FX33 / FX55 writing over reachable code
+    std::vector<int> selfModifyingWrites;
+    // BNNN, targets unknown so anything after may be code
+    std::vector<int> indirectJumps;
+    // FX33 / FX55 with I not known, may write anywhere
+    std::vector<int> unknownWrites;
+
+    // code that can't be written, as far as the analysis can tell
+    bool pureCode();
+};
+
+// follow control flow from the entry point, and classify every byte
+romMetadata analyseProgram(const unsigned char* program, std::size_t size);
+
+// FNV-1a, used to match metadata to a program
+std::uint32_t hashProgram(const unsigned char* program, std::size_t size);
+
+// mnemonic for one instruction, e.g. "LD I, 0x250"
+std::string disassemble(unsigned short opcode);
+
+// print a listing of program, instructions for code and bytes for data
+void printDisassembly(const unsigned char* program, std::size_t size, romMetadata& metadata);
+
+// metadata cache lives next to the rom, e.g. pong.ch8.meta
+std::filesystem::path metadataPath(std::filesystem::path pathName);
+bool saveMetadata(std::filesystem::path pathName, romMetadata& metadata);
+// false if missing, unreadable or not for this program
+bool loadMetadata(std::filesystem::path pathName, const unsigned char* program, std::size_t size,
+                  romMetadata& metadata);
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cstdarg>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iterator>
@@ -11,38 +13,64 @@
 
 typedef unsigned char byte;
 
+const int memorySize = 4096;
+const int gfxSize = 64 * 32;
+const int fontStartAddress = 0x50;
+
 void chip8::initialise()
 {
-    std::cout << "initialising" << std::endl;
+    if (verbose) { std::cout << "initialising" << std::endl; }
+
+    // clear memory
+    std::memset(memory, 0x00, sizeof(memory));
+
+    // reset() loads the fontset, along with everything else it covers
+    dirtyLow = fontStartAddress;
+    dirtyHigh = fontStartAddress + sizeof(chip8_fontset);
+    gfxDirty = true;
+
+    reset();
+}
+
+void chip8::reset()
+{
     pc = 0x200;  // prior bytes reserved
     opcode = 0;
     I = 0;
     sp = 0;
     programSize = 0;
+    fault = chip8Fault::none;
+    // same sequence after every reset, so runs can be replayed
+    rngState = rngSeed != 0 ? rngSeed : 1;
 
-    // clear display call
-    drawFlag = false;
-    clearGfx();
-
-    // clear stack
-    for (int i = 0; i < 16; ++i) { stack[i] = 0x00; }
-
-    // clear registers
-    for (int i = 0; i < 16; ++i) { V[i] = 0x00; }
-
-    // clear memory
-    for (int i = 0; i < 4096; ++i) { memory[i] = 0x00; }
+    // clear only the memory written since the last reset, then put back any of the fontset in it
+    if (dirtyLow < dirtyHigh)
+    {
+        std::memset(memory + dirtyLow, 0x00, dirtyHigh - dirtyLow);
 
-    // clear keys
-    for (int i = 0; i < 16; ++i) { key[i] = 0x00; }
+        int fontLow = std::max(dirtyLow, fontStartAddress);
+        int fontHigh = std::min(dirtyHigh, fontStartAddress + (int) sizeof(chip8_fontset));
+        if (fontLow < fontHigh)
+        {
+            std::memcpy(memory + fontLow, chip8_fontset + fontLow - fontStartAddress, fontHigh - fontLow);
+        }
+    }
+    dirtyLow = sizeof(memory);
+    dirtyHigh = 0;
 
-    // load fontset
-    unsigned char buffer = 0x50;
-    for (int i = 0; i < 80; ++i)
+    // clear display call
+    drawFlag = false;
+    if (gfxDirty)
     {
-        memory[buffer + i] = chip8_fontset[i];
+        clearGfx();
+        gfxDirty = false;
     }
 
+    // clear stack, registers and keys
+    std::memset(stack, 0x00, sizeof(stack));
+    std::memset(V, 0x00, sizeof(V));
+    std::memset(key, 0x00, sizeof(key));
+
     // reset timers
     delayTimer = 0;
     soundTimer = 0;
@@ -53,7 +81,7 @@ void chip8::initialise()
 
 bool chip8::loadProgram(std::filesystem::path pathName)
 {
-    std::cout << "loading program" << std::endl;
+    if (verbose) { std::cout << "loading program" << std::endl; }
 
     if (!std::filesystem::exists(pathName))
     {
@@ -67,32 +95,87 @@ bool chip8::loadProgram(std::filesystem::path pathName)
         return false;
     }
 
-    // TODO: build a size check for file
-
     std::vector<byte> buffer(
         (std::istreambuf_iterator<char>(file)),
          std::istreambuf_iterator<char>()
     );
 
+    if (!loadProgram(buffer.data(), buffer.size()))
+    {
+        return false;
+    }
+
+    if (verbose) { std::cout << "loaded program" << std::endl; }
+    return true;
+}
+
+bool chip8::loadProgram(const unsigned char* data, std::size_t size)
+{
     int romStartAddress = 512;
-    for (int i = 0; i < buffer.size(); ++i)
+    if (size > sizeof(memory) - romStartAddress)
     {
-        memory[romStartAddress + i] = buffer[i];
+        return false;
     }
 
-    programSize = buffer.size();
+    std::memcpy(memory + romStartAddress, data, size);
+    markDirty(romStartAddress, romStartAddress + size);
 
-    std::cout << "loaded program" << std::endl;
+    programSize = size;
     return true;
 }
 
+void chip8::emulateCycles(int count)
+{
+    for (int i = 0; i < count && fault == chip8Fault::none; ++i)
+    {
+        // keys and timers only change between calls, so nothing would for the rest of count
+        if (idle())
+        {
+            opcode = memory[pc] << 8 | memory[pc + 1];
+            cycleCount += count - i;
+            return;
+        }
+
+        emulateCycle();
+    }
+}
+
+bool chip8::idle()
+{
+    if (pc >= memorySize - 1) { return false; }
+
+    unsigned short next = memory[pc] << 8 | memory[pc + 1];
+
+    // 1NNN jumping to itself
+    if (next == (0x1000 | pc)) { return true; }
+
+    // FX0A with no key down
+    if ((next & 0xF0FF) == 0xF00A)
+    {
+        for (int k = 0; k < 16; ++k)
+        {
+            if (key[k]) { return false; }
+        }
+        return true;
+    }
+
+    return false;
+}
+
 void chip8::emulateCycle()
 {
-    std::cout << "emulating cycle " << cycleCount << std::endl;
+    if (fault != chip8Fault::none) { return; }
+
+    if (verbose) { std::cout << "emulating cycle " << cycleCount << std::endl; }
 
     // fetch opcode
+    if (checked && pc > sizeof(memory) - 2)
+    {
+        raise(chip8Fault::memoryOverrun);
+        return;
+    }
     opcode = memory[pc] << 8 | memory[pc + 1];
-    printf("Got opcode: 0x%X\n", opcode);
+    if (verbose) { printf("Got opcode: 0x%X\n", opcode); }
 
     // decode, execute opcode by looking at first 4 bits (e.g. the X in 0xX)
     switch(opcode & 0xF000)
@@ -100,24 +183,25 @@ void chip8::emulateCycle()
         // first 4 bits aren't clear enough in this instance
         case 0x0000:
         {
-            switch(opcode & 0x000F)
+            switch(opcode)
             {
                 // 0x00E0: clear screen
-                case 0x0000:
+                case 0x00E0:
                 {
                     clearGfx();
                     pc += 2;
                     break;
                 }
                 // 0x00EE: return from subroutine
-                case 0x000E:
+                case 0x00EE:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
                 default:
-                    printf("Unknown opcode [0x0000]: 0x%X\n", opcode);
+                    trace("Unknown opcode [0x0000]: 0x%X\n", opcode);
+                    raise(chip8Fault::badOpcode);
                     break;
             }
             break;
@@ -133,6 +217,11 @@ void chip8::emulateCycle()
         // 2NNN: run subroutine at NNN
         case 0x2000:
         {
+            if (checked && sp >= 16)
+            {
+                raise(chip8Fault::stackOverflow);
+                return;
+            }
             stack[sp] = pc;
             ++sp;
             pc = opcode & 0x0FFF;
@@ -142,30 +231,27 @@ void chip8::emulateCycle()
         // 3XNN: skip next instruction if VX == NN
         case 0x3000:
         {
-            if (V[(opcode & 0x0F00) >> 8] == opcode & 0x00FF)
-            {
-                pc += 2;
-            }
+            pc += V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF) ? 4 : 2;
             break;
         }
 
         // 4XNN: skip next instruction if VX != NN
         case 0x4000:
         {
-            if (V[(opcode & 0x0F00) >> 8] != opcode & 0x00FF)
-            {
-                pc += 2;
-            }
+            pc += V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF) ? 4 : 2;
             break;
         }
 
         // 5XY0: skip next instruction if VX == VY
         case 0x5000:
         {
-            if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
+            if ((opcode & 0x000F) != 0)
             {
-                pc += 2;
+                trace("Unknown opcode [0x5000]: 0x%X\n", opcode);
+                raise(chip8Fault::badOpcode);
+                break;
             }
+            pc += V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4] ? 4 : 2;
             break;
         }
 
@@ -220,41 +306,42 @@ void chip8::emulateCycle()
                 // 8XY4: add VY to VX. VF set to 1 when carrying, otherwise 0
                 case 0x0004:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
                 // 8XY5: subtract VY from VX. VF set to 0 when borrowing, otherwise 0
                 case 0x0005:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
                 // 8XY6: store least-significant bit of VX in VF, then shift VX right by 1
                 case 0x0006:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
                 // 8XY7: set VX to VY minus VX. VF set to 0 when there is a borrow, otherwise 1
                 case 0x0007:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
                 // 8XYE: store most-significant bit of VX in VF, then shift VX left by 1
                 case 0x000E:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
 
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
+                    trace("Unknown opcode: 0x%X\n", opcode);
+                    raise(chip8Fault::badOpcode);
                     break;
             }
             break;
@@ -263,10 +350,13 @@ void chip8::emulateCycle()
         // 9XY0: skip next instruction if VX != VY
         case 0x9000:
         {
-            if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
+            if ((opcode & 0x000F) != 0)
             {
-                pc += 2;
+                trace("Unknown opcode [0x9000]: 0x%X\n", opcode);
+                raise(chip8Fault::badOpcode);
+                break;
             }
+            pc += V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4] ? 4 : 2;
             break;
         }
 
@@ -288,8 +378,7 @@ void chip8::emulateCycle()
         // CXNN: set VX to result of bitwise AND operation on random number (0 - 255) and NN
         case 0xC000:
         {
-            std::srand((unsigned) std::time(NULL));
-            int randomNumber = 0 + (rand() % 256);
+            int randomNumber = nextRandom() & 0xFF;
 
             V[(opcode & 0x0F00) >> 8] = (opcode & 0x00FF) & randomNumber;
             pc += 2;
@@ -301,16 +390,23 @@ void chip8::emulateCycle()
         // Pixel set using bitwise XOR - current state compared w/ value in memory, if different 1 else 0
         case 0xD000:
         {
-            unsigned short x = V[(opcode & 0x0F00) >> 8];
-            unsigned short y = V[(opcode & 0x00F0) >> 4];
+            // the start wraps around the screen, the rest of the sprite is clipped at the edges
+            unsigned short x = V[(opcode & 0x0F00) >> 8] % 64;
+            unsigned short y = V[(opcode & 0x00F0) >> 4] % 32;
             unsigned short height = opcode & 0x000F;
             unsigned short pixel;
 
+            if (checked && I + height > memorySize)
+            {
+                raise(chip8Fault::memoryOverrun);
+                return;
+            }
+
             V[0xF] = 0;  // reset VF
-            for (int yline = 0; yline < height; ++yline)
+            for (int yline = 0; yline < height && y + yline < 32; ++yline)
             {
                 pixel = memory[I + yline];
-                for (int xline = 0; xline < 8; ++xline)
+                for (int xline = 0; xline < 8 && x + xline < 64; ++xline)
                 {
                     if ((pixel & (0x80 >> xline)) != 0)
                     {
@@ -319,6 +415,7 @@ void chip8::emulateCycle()
                     }
                 }
             }
+            gfxDirty = true;
             drawFlag = true;
             pc += 2;
             break;
@@ -326,25 +423,25 @@ void chip8::emulateCycle()
 
         case 0xE000:
         {
-            switch(opcode & 0x000F)
+            switch(opcode & 0x00FF)
             {
                 // EX9E: skip next instruction if key stored in VX is pressed
-                case 0x000E:
+                case 0x009E:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
-                    pc += 2;  // TODO: check if needed
+                    // only the low nibble names a key
+                    pc += key[V[(opcode & 0x0F00) >> 8] & 0x0F] ? 4 : 2;
                     break;
                 }
                 // EXA1: skip next instruction if key stored in VX is not pressed
-                case 0x0001:
+                case 0x00A1:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
-                    pc += 2;  // TODO: check if needed
+                    pc += key[V[(opcode & 0x0F00) >> 8] & 0x0F] ? 2 : 4;
                     break;
                 }
 
                 default:
-                    printf("Unknown opcode [0xE000]: 0x%X\n", opcode);
+                    trace("Unknown opcode [0xE000]: 0x%X\n", opcode);
+                    raise(chip8Fault::badOpcode);
             }
             break;
         }
@@ -361,14 +458,19 @@ void chip8::emulateCycle()
                     break;
                 }
 
-                // FX0A: wait for keypress then store in VX (blocking operation)
+                // FX0A: wait for keypress then store in VX.
+                //       pc is left alone until a key is down, so the wait is spread over cycles
                 case 0x000A:
                 {
-                    int n;
-                    std::cout << "input: ";
-                    std::cin >> n;  // TODO: tie this in with proper key inputs
-                    std::cout << n << std::endl;
-                    pc += 2;
+                    for (int k = 0; k < 16; ++k)
+                    {
+                        if (key[k])
+                        {
+                            V[(opcode & 0x0F00) >> 8] = k;
+                            pc += 2;
+                            break;
+                        }
+                    }
                     break;
                 }
 
@@ -399,7 +501,7 @@ void chip8::emulateCycle()
                 // FX29: set I to location of sprite for character in VX. Chars 0 - F represented by 4x5 font
                 case 0x0029:
                 {
-                    printf("Not yet implemented: 0x%X\n", opcode);
+                    trace("Not yet implemented: 0x%X\n", opcode);
                     pc += 2;  // TODO: check if needed
                     break;
                 }
@@ -410,9 +512,15 @@ void chip8::emulateCycle()
                 //       ones digit at I+2
                 case 0x0033:
                 {
+                    if (checked && I + 3 > memorySize)
+                    {
+                        raise(chip8Fault::memoryOverrun);
+                        return;
+                    }
                     memory[I] = (V[(opcode & 0x0F00) >> 8] / 100) % 10;  // TODO: probs check maths
                     memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
                     memory[I + 2] = V[(opcode & 0x0F00) >> 8] % 10;
+                    markDirty(I, I + 3);
                     pc += 2;
                     break;
                 }
@@ -421,10 +529,16 @@ void chip8::emulateCycle()
                 //       Offset from I increased by 1 each time, I left unchanged
                 case 0x0055:
                 {
+                    if (checked && I + ((opcode & 0x0F00) >> 8) >= memorySize)
+                    {
+                        raise(chip8Fault::memoryOverrun);
+                        return;
+                    }
                     for (int x = 0; x <= (opcode & 0x0F00) >> 8; ++x)
                     {
                         memory[I + x] = V[x];
                     }
+                    markDirty(I, I + ((opcode & 0x0F00) >> 8) + 1);
                     pc += 2;
                     break;
                 }
@@ -433,6 +547,11 @@ void chip8::emulateCycle()
                 //       Offset from I increased by 1 each time, I left unchanged
                 case 0x0065:
                 {
+                    if (checked && I + ((opcode & 0x0F00) >> 8) >= memorySize)
+                    {
+                        raise(chip8Fault::memoryOverrun);
+                        return;
+                    }
                     for (int x = 0; x <= (opcode & 0x0F00) >> 8; ++x)
                     {
                         V[x] = memory[I + x];
@@ -442,34 +561,76 @@ void chip8::emulateCycle()
                 }
 
                 default:
-                    printf("Unknown opcode [0xF000]: 0x%X\n", opcode);
+                    trace("Unknown opcode [0xF000]: 0x%X\n", opcode);
+                    raise(chip8Fault::badOpcode);
                     break;
             }
             break;
         }
 
         default:
-            printf("Unknown opcode: 0x%X\n", opcode);
+            trace("Unknown opcode: 0x%X\n", opcode);
+            raise(chip8Fault::badOpcode);
     }
 
-    // update timers
+    ++cycleCount;
+}
+
+void chip8::tickTimers()
+{
     if (delayTimer > 0) { --delayTimer; }
     if (soundTimer > 0)
     {
-        if (soundTimer == 1) { std::cout << "beep" << std::endl; }
+        if (soundTimer == 1 && verbose) { std::cout << "beep" << std::endl; }
         --soundTimer;
     }
+}
 
-    ++cycleCount;
+void chip8::setKey(int index, bool pressed)
+{
+    if (index < 0 || index >= 16) { return; }
+    key[index] = pressed ? 1 : 0;
 }
 
 void chip8::clearGfx()
 {
-    for (int i = 0; i < (64 * 32); ++i) { gfx[i] = 0x00; }
+    std::memset(gfx, 0x00, sizeof(gfx));
 }
 
 unsigned char* chip8::getGfx() { return gfx; }
 
+chip8Fault chip8::getFault() { return fault; }
+
+void chip8::markDirty(int startByte, int stopByte)
+{
+    dirtyLow = std::min(dirtyLow, startByte);
+    dirtyHigh = std::max(dirtyHigh, std::min(stopByte, (int) sizeof(memory)));
+}
+
+void chip8::raise(chip8Fault reason)
+{
+    if (checked) { fault = reason; }
+}
+
+unsigned int chip8::nextRandom()
+{
+    // xorshift32
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+void chip8::trace(const char* format, ...)
+{
+    if (!verbose) { return; }
+
+    va_list args;
+    va_start(args, format);
+    std::vprintf(format, args);
+    va_end(args);
+}
+
 void chip8::getCurrentState()
 {
     printf("opcode: 0x%X\n", opcode);
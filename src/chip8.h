@@ -1,8 +1,17 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
 #include <vector>
 
+// reasons checked mode can stop the machine
+enum class chip8Fault {
+    none,
+    stackOverflow,  // 2NNN with all 16 stack levels in use
+    memoryOverrun,  // pc, I or a sprite reaching past memory / gfx
+    badOpcode  // opcode that doesn't decode to any instruction
+};
+
 class chip8 {
 private:
     int cycleCount;
@@ -45,15 +54,47 @@ private:
 
     int programSize;
 
+    // [dirtyLow, dirtyHigh) bounds every memory byte written since the last reset
+    int dirtyLow;
+    int dirtyHigh;
+    // set once a sprite has been drawn, so reset() can skip clearing gfx
+    bool gfxDirty;
+
+    chip8Fault fault;
+
+    void markDirty(int startByte, int stopByte);
+    // record a fault (checked mode only), the machine won't run until reset
+    void raise(chip8Fault reason);
+    // xorshift state for CXNN, restarted from rngSeed by reset()
+    unsigned int rngState;
+    unsigned int nextRandom();
+
+    // printf, but only when verbose
+    void trace(const char* format, ...);
+
 public:
     // initialise all registers and memory locations
     void initialise();
+    // restore the state initialise() left, touching only what has changed since.
+    // Much cheaper than initialise(), which it requires to have been called once
+    void reset();
     // load contents of pathName into memory
     bool loadProgram(std::filesystem::path pathName);
-    // fetch, decode, execute opcode; update timers
+    // load size bytes of data into memory as the program
+    bool loadProgram(const unsigned char* data, std::size_t size);
+    // fetch, decode, execute opcode
     void emulateCycle();
+    // emulateCycle count times, or until a fault. Stops early once idle()
+    void emulateCycles(int count);
+    // true while the next instruction can't change anything until a key or timer does:
+    // a 1NNN jumping to itself, or FX0A with no key down
+    bool idle();
+    // count delay and sound timers down, to be called at 60Hz
+    void tickTimers();
     // get current state of key presses
     void setKeys();
+    // set key 0x0 - 0xF as pressed or released, read by EX9E, EXA1 and FX0A
+    void setKey(int index, bool pressed);
 
     // dumps values of all private member variables except memory
     void getCurrentState();
@@ -69,8 +110,21 @@ public:
     // return the gfx array for drawing
     unsigned char* getGfx();
 
+    // fault that stopped the machine, chip8Fault::none while it can run
+    chip8Fault getFault();
+
     bool drawFlag;
 
+    // print progress and unimplemented / unknown opcodes to stdout
+    bool verbose = true;
+
+    // CXNN sequence starts from this on every reset, so runs are repeatable
+    unsigned int rngSeed = 0x2545F491;
+
+    // bounds check stack, memory and opcodes, stopping with a fault instead of
+    // running off the end of an array
+    bool checked = false;
+
     // the 'official' fontset of chip8
     unsigned char chip8_fontset[80] =
     {
@@ -0,0 +1,74 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "analyser.h"
+
+std::string filePath;
+bool writeCache = true;
+
+void showHelpAndExit()
+{
+    std::cout << "chip8 disassembler" << std::endl;
+    std::cout << "-p / --path      path to rom, metadata is cached alongside as <rom>.meta" << std::endl;
+    std::cout << "-n / --no-cache  don't write the metadata file" << std::endl;
+    std::cout << "-h / --help      show this help message" << std::endl;
+    exit(0);
+}
+
+void parseArgs(int argc, char* argv[])
+{
+    if (argc < 2) { showHelpAndExit(); }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--help" || arg == "-h") { showHelpAndExit(); }
+        else if ((arg == "--path" || arg == "-p") && i + 1 < argc) { filePath = argv[++i]; }
+        else if (arg == "--no-cache" || arg == "-n") { writeCache = false; }
+        else { showHelpAndExit(); }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "Unable to load program, exiting." << std::endl;
+        exit(1);
+    }
+    std::vector<unsigned char> rom(
+        (std::istreambuf_iterator<char>(file)),
+         std::istreambuf_iterator<char>()
+    );
+
+    // reuse the cached analysis when it's still for this rom
+    romMetadata metadata;
+    bool cached = loadMetadata(metadataPath(filePath), rom.data(), rom.size(), metadata);
+    if (!cached)
+    {
+        metadata = analyseProgram(rom.data(), rom.size());
+    }
+
+    printDisassembly(rom.data(), rom.size(), metadata);
+
+    std::cout << std::endl;
+    std::cout << "idle loops: " << metadata.idleLoops.size() << std::endl;
+    std::cout << "polling loops: " << metadata.pollingLoops.size() << std::endl;
+    std::cout << "self-modifying writes: " << metadata.selfModifyingWrites.size() << std::endl;
+    std::cout << "pure code: " << (metadata.pureCode() ? "yes" : "no") << std::endl;
+
+    if (!cached && writeCache && !saveMetadata(metadataPath(filePath), metadata))
+    {
+        std::cout << "Unable to write " << metadataPath(filePath) << std::endl;
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "host.h"
+
+// 60Hz
+const long framePeriodNs = 1000000000L / 60;
+
+// how many sessions to run between deadline checks
+const int deadlineCheckInterval = 32;
+
+static std::uint64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (std::uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool hostWorker::initialise(const std::vector<unsigned char>* program, int cyclesPerFrame)
+{
+    rom = program;
+    instructionsPerFrame = cyclesPerFrame;
+    nextSession = 0;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || timerFd < 0 || wakeFd < 0)
+    {
+        return false;
+    }
+
+    // absolute deadlines, so a slow frame doesn't push every later one back
+    itimerspec period = {};
+    period.it_interval.tv_nsec = framePeriodNs;
+    clock_gettime(CLOCK_MONOTONIC, &period.it_value);
+    nextTick = (std::uint64_t) period.it_value.tv_sec * 1000000000ULL + period.it_value.tv_nsec;
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &period, nullptr) < 0)
+    {
+        return false;
+    }
+
+    // timer and wake fds are told apart from sessions by pointing at the fd member
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &timerFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event) < 0) { return false; }
+    event.data.ptr = &wakeFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) { return false; }
+
+    return true;
+}
+
+void hostWorker::addConnection(int fd)
+{
+    {
+        std::lock_guard<std::mutex> lock(incomingMutex);
+        incoming.push_back(fd);
+    }
+    ++sessionCount;
+
+    std::uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+}
+
+void hostWorker::acceptIncoming()
+{
+    std::uint64_t count;
+    read(wakeFd, &count, sizeof(count));
+
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(incomingMutex);
+        fds.swap(incoming);
+    }
+
+    for (int fd : fds)
+    {
+        auto s = std::make_unique<session>();
+        s->fd = fd;
+        s->closed = false;
+        s->machine.verbose = false;
+        // the rom is shared by every session, a fault only closes this one
+        s->machine.checked = true;
+        s->machine.initialise();
+        if (!s->machine.loadProgram(rom->data(), rom->size()))
+        {
+            close(fd);
+            --sessionCount;
+            continue;
+        }
+        std::memcpy(s->lastGfx, s->machine.getGfx(), sizeof(s->lastGfx));
+
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = s.get();
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            close(fd);
+            --sessionCount;
+            continue;
+        }
+        sessions.push_back(std::move(s));
+    }
+}
+
+void hostWorker::readInput(session& s)
+{
+    unsigned char packet[2];
+    for (;;)
+    {
+        ssize_t n = recv(s.fd, packet, sizeof(packet), MSG_DONTWAIT);
+        if (n == sizeof(packet))
+        {
+            s.machine.setKey(packet[0], packet[1] != 0);
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        else if (n <= 0)
+        {
+            s.closed = true;
+            return;
+        }
+        // anything else is a malformed packet, drop it
+    }
+}
+
+void hostWorker::runFrame()
+{
+    // the timer's next expiry, however late this frame started
+    std::uint64_t deadline = nextTick;
+    std::size_t total = sessions.size();
+    if (nextSession >= total) { nextSession = 0; }
+
+    for (std::size_t done = 0; done < total; ++done)
+    {
+        session& s = *sessions[(nextSession + done) % total];
+        if (!s.closed)
+        {
+            s.machine.emulateCycles(instructionsPerFrame);
+            s.machine.tickTimers();
+
+            // taken every frame, whichever opcode changed the screen.
+            // The last frame still goes out before a faulted session is closed
+            sendFrameDelta(s);
+            if (s.machine.getFault() != chip8Fault::none)
+            {
+                s.closed = true;
+            }
+        }
+
+        // out of time, the rest run first next frame instead of delaying it
+        if ((done + 1) % deadlineCheckInterval == 0 && done + 1 < total && nowNs() >= deadline)
+        {
+            nextSession = (nextSession + done + 1) % total;
+            ++deferredFrames;
+            return;
+        }
+    }
+}
+
+void hostWorker::sendFrameDelta(session& s)
+{
+    const unsigned char* gfx = s.machine.getGfx();
+
+    // row count + 32 * (row + 8 bytes of pixels)
+    unsigned char packet[1 + 32 * 9];
+    int length = 1;
+    unsigned char rows = 0;
+
+    for (int row = 0; row < 32; ++row)
+    {
+        const unsigned char* current = gfx + row * 64;
+        if (std::memcmp(current, s.lastGfx + row * 64, 64) == 0) { continue; }
+
+        packet[length++] = row;
+        for (int byte = 0; byte < 8; ++byte)
+        {
+            unsigned char bits = 0;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                bits |= (current[byte * 8 + bit] & 1) << (7 - bit);
+            }
+            packet[length++] = bits;
+        }
+        ++rows;
+    }
+    packet[0] = rows;
+
+    s.machine.drawFlag = false;
+    if (rows == 0) { return; }
+
+    ssize_t sent = send(s.fd, packet, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent == length)
+    {
+        std::memcpy(s.lastGfx, gfx, sizeof(s.lastGfx));
+    }
+    else if (!(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+    {
+        s.closed = true;
+    }
+    // on a slow client lastGfx is left alone, so the next delta covers this frame too
+}
+
+void hostWorker::removeClosed()
+{
+    // compact in order, so nextSession still points at the sessions a deadline cut off
+    std::size_t kept = 0;
+    std::size_t removedBeforeNext = 0;
+    for (std::size_t i = 0; i < sessions.size(); ++i)
+    {
+        if (sessions[i]->closed)
+        {
+            close(sessions[i]->fd);  // also removes it from epoll
+            --sessionCount;
+            if (i < nextSession) { ++removedBeforeNext; }
+            continue;
+        }
+        if (kept != i) { sessions[kept] = std::move(sessions[i]); }
+        ++kept;
+    }
+    sessions.resize(kept);
+    nextSession -= removedBeforeNext;
+}
+
+void hostWorker::run(const std::atomic<bool>& running)
+{
+    const int maxEvents = 256;
+    epoll_event events[maxEvents];
+
+    while (running)
+    {
+        int count = epoll_wait(epollFd, events, maxEvents, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+
+        bool frameDue = false;
+        for (int i = 0; i < count; ++i)
+        {
+            void* source = events[i].data.ptr;
+            if (source == &timerFd)
+            {
+                std::uint64_t expirations = 0;
+                read(timerFd, &expirations, sizeof(expirations));
+                nextTick += expirations * framePeriodNs;
+                // only ever run one frame per tick, catching up would make the overrun worse
+                if (expirations > 1) { missedFrames += expirations - 1; }
+                frameDue = expirations > 0;
+            }
+            else if (source == &wakeFd)
+            {
+                acceptIncoming();
+            }
+            else
+            {
+                session& s = *static_cast<session*>(source);
+                if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))
+                {
+                    s.closed = true;
+                }
+                else if (!s.closed)
+                {
+                    readInput(s);
+                }
+            }
+        }
+
+        // input first, so key presses from this tick are seen by the frame
+        if (frameDue) { runFrame(); }
+        removeClosed();
+    }
+}
+
+void hostWorker::shutdown()
+{
+    for (auto& s : sessions) { close(s->fd); }
+    sessions.clear();
+    for (int fd : incoming) { close(fd); }
+    incoming.clear();
+    sessionCount = 0;
+
+    // initialise() may have failed part way through
+    if (epollFd >= 0) { close(epollFd); }
+    if (timerFd >= 0) { close(timerFd); }
+    if (wakeFd >= 0) { close(wakeFd); }
+    epollFd = timerFd = wakeFd = -1;
+}
+
+bool sessionHost::initialise(const std::vector<unsigned char>& program, const std::string& path,
+                             int threadCount, int instructionsPerFrame)
+{
+    rom = program;
+    socketPath = path;
+
+    // every session loads the same rom, so refuse it now rather than per connection
+    chip8 probe;
+    probe.verbose = false;
+    probe.initialise();
+    if (rom.empty() || !probe.loadProgram(rom.data(), rom.size()))
+    {
+        std::cout << "rom is empty or too big (" << rom.size() << " bytes)" << std::endl;
+        return false;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        std::cout << "socket path too long" << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    // only ever replace a stale socket, never some other file at the path
+    struct stat existing;
+    if (lstat(socketPath.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            std::cout << socketPath << " exists and is not a socket" << std::endl;
+            return false;
+        }
+        unlink(socketPath.c_str());
+    }
+
+    // SOCK_SEQPACKET keeps message boundaries, one packet per key event or frame delta
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) { return false; }
+
+    if (bind(listenFd, (sockaddr*) &address, sizeof(address)) < 0)
+    {
+        std::cout << "unable to listen on " << socketPath << std::endl;
+        close(listenFd);
+        return false;
+    }
+
+    bool started = listen(listenFd, SOMAXCONN) == 0;
+    if (!started) { std::cout << "unable to listen on " << socketPath << std::endl; }
+
+    for (int i = 0; started && i < threadCount; ++i)
+    {
+        workers.push_back(std::make_unique<hostWorker>());
+        started = workers.back()->initialise(&rom, instructionsPerFrame);
+    }
+
+    if (!started)
+    {
+        for (auto& worker : workers) { worker->shutdown(); }
+        workers.clear();
+        close(listenFd);
+        unlink(socketPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void sessionHost::run()
+{
+    running = true;
+    for (auto& worker : workers)
+    {
+        threads.emplace_back(&hostWorker::run, worker.get(), std::cref(running));
+    }
+
+    pollfd listener = { listenFd, POLLIN, 0 };
+    while (running)
+    {
+        // wake up now and then to notice stop()
+        if (poll(&listener, 1, 100) <= 0) { continue; }
+
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) { continue; }
+
+        // least loaded worker
+        hostWorker* target = workers.front().get();
+        for (auto& worker : workers)
+        {
+            if (worker->sessionCount < target->sessionCount) { target = worker.get(); }
+        }
+        target->addConnection(fd);
+    }
+
+    // workers notice running on their next timer tick
+    for (auto& thread : threads) { thread.join(); }
+    threads.clear();
+    for (auto& worker : workers) { worker->shutdown(); }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+}
+
+void sessionHost::stop() { running = false; }
+
+void sessionHost::printStats()
+{
+    for (std::size_t i = 0; i < workers.size(); ++i)
+    {
+        std::cout << "worker " << i
+                  << ": sessions " << workers[i]->sessionCount
+                  << ", missed frames " << workers[i]->missedFrames
+                  << ", deferred frames " << workers[i]->deferredFrames << std::endl;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chip8.h"
+
+// one connected player
+//
+// input packets:  2 bytes, key (0x0 - 0xF) then pressed (0 or 1)
+// output packets: 1 byte row count, then for each changed row the row number
+//                 followed by its 64 pixels packed into 8 bytes (MSB first)
+struct session {
+    int fd;
+    chip8 machine;
+    // gfx as last sent to the client, deltas are taken against this
+    unsigned char lastGfx[64 * 32];
+    // closed sessions are removed once the current batch of events is handled
+    bool closed;
+};
+
+// runs a share of the sessions on its own thread, epoll loop and 60Hz timer
+class hostWorker {
+private:
+    int epollFd = -1;
+    int timerFd = -1;
+    int wakeFd = -1;  // eventfd, signalled when connections are queued
+
+    // connections handed over by the accept thread, not yet sessions
+    std::mutex incomingMutex;
+    std::vector<int> incoming;
+
+    std::vector<std::unique_ptr<session>> sessions;
+    // where the next frame starts, so sessions cut off by a deadline go first
+    std::size_t nextSession;
+    // CLOCK_MONOTONIC ns of the timer's next expiry, the deadline for the current frame
+    std::uint64_t nextTick;
+
+    const std::vector<unsigned char>* rom;
+    int instructionsPerFrame;
+
+    void acceptIncoming();
+    void readInput(session& s);
+    void runFrame();
+    // send the rows that differ from lastGfx, if any
+    void sendFrameDelta(session& s);
+    void removeClosed();
+
+public:
+    // sessions on this worker, read by the accept thread for balancing
+    std::atomic<int> sessionCount{0};
+    // frames dropped because the previous frame overran its deadline
+    std::atomic<std::uint64_t> missedFrames{0};
+    // frames stopped early at the deadline, with sessions deferred to the next
+    std::atomic<std::uint64_t> deferredFrames{0};
+
+    // set up epoll, timer and wake fds
+    bool initialise(const std::vector<unsigned char>* program, int cyclesPerFrame);
+    // queue a connected socket to become a session on this worker
+    void addConnection(int fd);
+    // event loop, returns once running is false
+    void run(const std::atomic<bool>& running);
+    // close every session and fd
+    void shutdown();
+};
+
+// accepts players on a unix socket and spreads them over a fixed pool of workers
+class sessionHost {
+private:
+    int listenFd;
+    std::string socketPath;
+    std::vector<unsigned char> rom;
+    std::vector<std::unique_ptr<hostWorker>> workers;
+    std::vector<std::thread> threads;
+
+public:
+    std::atomic<bool> running{false};
+
+    // load the rom every session runs, and listen on socketPath
+    bool initialise(const std::vector<unsigned char>& program, const std::string& path,
+                    int threadCount, int instructionsPerFrame);
+    // accept connections until stop(), then join workers
+    void run();
+    void stop();
+
+    // print session and deadline counts per worker
+    void printStats();
+};
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "host.h"
+
+sessionHost host;
+
+std::string filePath;
+std::string socketPath = "/tmp/chip8-host.sock";
+int threadCount = std::max(1u, std::thread::hardware_concurrency());
+int instructionsPerFrame = 10;
+
+void showHelpAndExit()
+{
+    std::cout << "chip8 session host" << std::endl;
+    std::cout << "-p / --path      path to rom run by every session" << std::endl;
+    std::cout << "-s / --socket    unix socket to listen on (default /tmp/chip8-host.sock)" << std::endl;
+    std::cout << "-t / --threads   worker threads (default one per core)" << std::endl;
+    std::cout << "-i / --ipf       instructions per 60Hz frame (default 10)" << std::endl;
+    std::cout << "-h / --help      show this help message" << std::endl;
+    exit(0);
+}
+
+void parseArgs(int argc, char* argv[])
+{
+    if (argc < 2) { showHelpAndExit(); }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--help" || arg == "-h") { showHelpAndExit(); }
+        else if ((arg == "--path" || arg == "-p") && hasValue) { filePath = argv[++i]; }
+        else if ((arg == "--socket" || arg == "-s") && hasValue) { socketPath = argv[++i]; }
+        else if ((arg == "--threads" || arg == "-t") && hasValue) { threadCount = std::max(1, std::atoi(argv[++i])); }
+        else if ((arg == "--ipf" || arg == "-i") && hasValue) { instructionsPerFrame = std::max(1, std::atoi(argv[++i])); }
+        else { showHelpAndExit(); }
+    }
+}
+
+void handleSignal(int) { host.stop(); }
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cout << "Unable to load program, exiting." << std::endl;
+        exit(1);
+    }
+    std::vector<unsigned char> rom(
+        (std::istreambuf_iterator<char>(file)),
+         std::istreambuf_iterator<char>()
+    );
+
+    if (!host.initialise(rom, socketPath, threadCount, instructionsPerFrame))
+    {
+        std::cout << "Unable to start host, exiting." << std::endl;
+        exit(1);
+    }
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    std::cout << "listening on " << socketPath << " with " << threadCount << " workers" << std::endl;
+    host.run();
+    host.printStats();
+
+    return 0;
+}
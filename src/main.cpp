@@ -1,4 +1,5 @@
 #include <cstring>
+#include <ctime>
 #include <iostream>
 
 #include <unistd.h>  // for sleep
@@ -40,6 +41,7 @@ int main(int argc, char* argv[])
     parseArgs(argc, argv);
 
     // Initialize the Chip8 system and load the game into the memory
+    myChip8.rngSeed = std::time(NULL);
     myChip8.initialise();
     bool programLoaded = myChip8.loadProgram(std::filesystem::path(filePath));
 
@@ -57,6 +59,7 @@ int main(int argc, char* argv[])
     {
         // Emulate one cycle
         myChip8.emulateCycle();
+        myChip8.tickTimers();
 
         // only draw when needed
         if (myChip8.drawFlag)